@@ -11,9 +11,14 @@
 #include "Utils/Trampoline.h"
 #include "Utils/Patterns.h"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <filesystem>
 #include <format>
 #include <fstream>
+#include <map>
+#include <mutex>
 
 #if _DEBUG
 #define DEBUG_DOCUMENTS_PATH	1
@@ -243,6 +248,207 @@ namespace RtResizeThreadFix
 	}
 }
 
+static std::filesystem::path logFilePath;
+
+namespace LargePageAllocations
+{
+	// Only bother with large pages for big pools allocated in one go
+	static constexpr SIZE_T MIN_ALLOCATION_SIZE = 8 * 1024 * 1024;
+	static constexpr uintptr_t PAGE_MASK = 0xFFF;
+
+	static SIZE_T largePageMinimum = 0;
+	static std::atomic<bool> largePagesFailed = false;
+
+	// Base address -> size of all live large page allocations, and their statistics
+	static std::mutex regionsMutex;
+	static std::map<uintptr_t, SIZE_T> regions;
+	static uint64_t liveBytes = 0;
+	static uint64_t peakBytes = 0;
+
+	static std::mutex logMutex;
+
+	bool EnableLockMemoryPrivilege()
+	{
+		HANDLE token;
+		if ( OpenProcessToken( GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token ) == FALSE )
+		{
+			return false;
+		}
+
+		TOKEN_PRIVILEGES privileges;
+		privileges.PrivilegeCount = 1;
+		privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+		bool result = false;
+		if ( LookupPrivilegeValue( nullptr, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid ) != FALSE )
+		{
+			// AdjustTokenPrivileges succeeds even if the privilege was not assigned, so GetLastError must be checked too
+			result = AdjustTokenPrivileges( token, FALSE, &privileges, 0, nullptr, nullptr ) != FALSE && GetLastError() == ERROR_SUCCESS;
+		}
+		CloseHandle( token );
+
+		if ( result )
+		{
+			largePageMinimum = GetLargePageMinimum();
+		}
+		return result && largePageMinimum != 0;
+	}
+
+	// Returns the size of the large page region containing the given address, or 0 if there is none
+	static SIZE_T FindRegion(LPVOID lpAddress, uintptr_t& base)
+	{
+		const uintptr_t address = reinterpret_cast<uintptr_t>(lpAddress);
+
+		std::lock_guard lock(regionsMutex);
+		auto it = regions.upper_bound(address);
+		if ( it != regions.begin() )
+		{
+			--it;
+			if ( address - it->first < it->second )
+			{
+				base = it->first;
+				return it->second;
+			}
+		}
+		return 0;
+	}
+
+	static void LogUsage(size_t liveAllocations, uint64_t live, uint64_t peak)
+	{
+		std::lock_guard lock(logMutex);
+		auto ofs = std::ofstream(logFilePath, std::ios::binary | std::ios::app | std::ios::out);
+		ofs << "Large page allocations: " << liveAllocations << " (" << live / (1024 * 1024) << " MB, peak " << peak / (1024 * 1024) << " MB)" << std::endl;
+	}
+
+	LPVOID WINAPI VirtualAlloc_LargePages(LPVOID lpAddress, SIZE_T dwSize, DWORD flAllocationType, DWORD flProtect)
+	{
+		if ( largePageMinimum != 0 )
+		{
+			if ( lpAddress == nullptr )
+			{
+				// Large pages must be reserved and committed at once, and can only be read/write
+				if ( !largePagesFailed && (flAllocationType & ~MEM_TOP_DOWN) == (MEM_RESERVE|MEM_COMMIT) && flProtect == PAGE_READWRITE && dwSize >= MIN_ALLOCATION_SIZE
+					&& dwSize <= SIZE_MAX - (largePageMinimum - 1) )
+				{
+					const SIZE_T alignedSize = (dwSize + largePageMinimum - 1) & ~(largePageMinimum - 1);
+					LPVOID result = VirtualAlloc(nullptr, alignedSize, flAllocationType | MEM_LARGE_PAGES, flProtect);
+					if ( result != nullptr )
+					{
+						size_t liveAllocations;
+						uint64_t live, peak;
+						{
+							std::lock_guard lock(regionsMutex);
+							auto [it, inserted] = regions.try_emplace(reinterpret_cast<uintptr_t>(result), alignedSize);
+							if ( !inserted )
+							{
+								// Stale entry for a region released behind our back - replace it
+								liveBytes -= it->second;
+								it->second = alignedSize;
+							}
+							liveBytes += alignedSize;
+							peakBytes = std::max(peakBytes, liveBytes);
+
+							liveAllocations = regions.size();
+							live = liveBytes;
+							peak = peakBytes;
+						}
+
+						LogUsage(liveAllocations, live, peak);
+						return result;
+					}
+
+					// Out of contiguous physical memory for a size that should have fit - physical memory is most likely
+					// too fragmented, and finding contiguous pages is slow, so don't retry for subsequent allocations.
+					// Any other failure only skips large pages for this allocation.
+					const DWORD error = GetLastError();
+					if ( error == ERROR_NO_SYSTEM_RESOURCES || error == ERROR_NOT_ENOUGH_MEMORY )
+					{
+						MEMORYSTATUSEX memoryStatus;
+						memoryStatus.dwLength = sizeof(memoryStatus);
+						if ( GlobalMemoryStatusEx( &memoryStatus ) != FALSE && alignedSize <= memoryStatus.ullAvailPhys )
+						{
+							if ( !largePagesFailed.exchange(true) )
+							{
+								std::lock_guard lock(logMutex);
+								auto ofs = std::ofstream(logFilePath, std::ios::binary | std::ios::app | std::ios::out);
+								ofs << "Large pages: disabled after a failed allocation (error " << error << ")" << std::endl;
+							}
+						}
+					}
+				}
+			}
+			else if ( flAllocationType == MEM_COMMIT && flProtect == PAGE_READWRITE && dwSize != 0 )
+			{
+				// Large pages are always committed, so committing them again is a no-op
+				uintptr_t base;
+				const SIZE_T regionSize = FindRegion(lpAddress, base);
+				if ( regionSize != 0 && reinterpret_cast<uintptr_t>(lpAddress) + dwSize <= base + regionSize )
+				{
+					return reinterpret_cast<LPVOID>(reinterpret_cast<uintptr_t>(lpAddress) & ~PAGE_MASK);
+				}
+			}
+		}
+		return VirtualAlloc(lpAddress, dwSize, flAllocationType, flProtect);
+	}
+
+	BOOL WINAPI VirtualFree_LargePages(LPVOID lpAddress, SIZE_T dwSize, DWORD dwFreeType)
+	{
+		if ( largePageMinimum != 0 )
+		{
+			uintptr_t base;
+			const SIZE_T regionSize = FindRegion(lpAddress, base);
+			if ( regionSize != 0 )
+			{
+				if ( dwFreeType == MEM_DECOMMIT )
+				{
+					// Large pages cannot be decommitted - keep them committed, but zero all touched pages
+					// so a recommit behaves like a fresh commit
+					const uintptr_t address = reinterpret_cast<uintptr_t>(lpAddress);
+					const uintptr_t start = address & ~PAGE_MASK;
+					const uintptr_t end = dwSize != 0 ? (address + dwSize + PAGE_MASK) & ~PAGE_MASK : base + regionSize;
+					if ( (dwSize != 0 || address == base) && end <= base + regionSize )
+					{
+						memset(reinterpret_cast<void*>(start), 0, end - start);
+						return TRUE;
+					}
+				}
+				else if ( dwFreeType == MEM_RELEASE )
+				{
+					size_t liveAllocations;
+					uint64_t live, peak;
+					{
+						// Release under the lock, so the same base address can't be handed out again
+						// and registered before this region is removed
+						std::lock_guard lock(regionsMutex);
+						auto it = regions.find(base);
+						if ( it == regions.end() )
+						{
+							return VirtualFree(lpAddress, dwSize, dwFreeType);
+						}
+
+						const BOOL result = VirtualFree(lpAddress, dwSize, dwFreeType);
+						if ( result == FALSE )
+						{
+							return result;
+						}
+
+						liveBytes -= it->second;
+						regions.erase(it);
+
+						liveAllocations = regions.size();
+						live = liveBytes;
+						peak = peakBytes;
+					}
+
+					LogUsage(liveAllocations, live, peak);
+					return TRUE;
+				}
+			}
+		}
+		return VirtualFree(lpAddress, dwSize, dwFreeType);
+	}
+}
+
 #if DEBUG_DOCUMENTS_PATH
 HRESULT WINAPI SHGetKnownFolderPath_Fake(REFKNOWNFOLDERID rfid, DWORD dwFlags, HANDLE hToken, PWSTR *ppszPath)
 {
@@ -339,6 +545,18 @@ static void RedirectImports()
 					*pAddress = UTF8PathFixes::MultiByteToWideChar_UTF8;
 					continue;
 				}
+				if ( strcmp(reinterpret_cast<PIMAGE_IMPORT_BY_NAME>(instance + pFunctions[j].u1.AddressOfData)->Name, "VirtualAlloc") == 0 )
+				{
+					void** pAddress = reinterpret_cast<void**>(instance + pImports->FirstThunk) + j;
+					*pAddress = LargePageAllocations::VirtualAlloc_LargePages;
+					continue;
+				}
+				if ( strcmp(reinterpret_cast<PIMAGE_IMPORT_BY_NAME>(instance + pFunctions[j].u1.AddressOfData)->Name, "VirtualFree") == 0 )
+				{
+					void** pAddress = reinterpret_cast<void**>(instance + pImports->FirstThunk) + j;
+					*pAddress = LargePageAllocations::VirtualFree_LargePages;
+					continue;
+				}
 			}
 			continue;
 		}
@@ -423,6 +641,18 @@ void OnInitializeHook()
 	}
 
 
+	{
+		std::error_code ec;
+		logFilePath = std::filesystem::absolute("SilentPatchYRC.txt", ec);
+		if ( ec )
+		{
+			logFilePath = "SilentPatchYRC.txt";
+		}
+	}
+
+	// Back big up-front allocations with large pages, if the user has the Lock Pages in Memory privilege
+	const bool largePagesEnabled = LargePageAllocations::EnableLockMemoryPrivilege();
+
 	RedirectImports();
 	
 	// Restore thread names	
@@ -641,7 +871,7 @@ void OnInitializeHook()
 		const auto tz = current_zone();
 		const auto t2 = tz->to_local(t1);
 		const auto s2 = std::format("{:%Y/%m/%d %H:%M:%S}", floor<seconds>(t2));
-		auto ofs = std::ofstream("SilentPatchYRC.txt", std::ios::binary | std::ios::trunc | std::ios::out);
+		auto ofs = std::ofstream(logFilePath, std::ios::binary | std::ios::trunc | std::ios::out);
 		if (game == Game::Yakuza3) {
 			ofs << "Game:  " << "Yakuza 3" << std::endl;
 		}
@@ -653,6 +883,7 @@ void OnInitializeHook()
 		}
 		ofs << "Local: " << s2 << std::endl;
 		ofs << "UTC:   " << s1 << std::endl;
+		ofs << "Large pages: " << (largePagesEnabled ? "enabled" : "unavailable") << std::endl;
 		ofs.close();
 	}
 }